@@ -1,4 +1,4 @@
 #!/bin/bash
 
-g++ -o SCCGC ./src/SCCGC.cpp
-g++ -o SCCGD ./src/SCCGD.cpp
+g++ -pthread -o SCCGC ./src/SCCGC.cpp
+g++ -pthread -o SCCGD ./src/SCCGD.cpp
@@ -3,20 +3,42 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
 #include <unordered_map>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "bgzf.h"
+#include "crc32c.h"
+#include "fasta.h"
+
 using namespace std;
 using HashTable = std::unordered_map<std::string, std::vector<int>>;
 
+// local segment index, kmers over ACGT are keyed on their canonical 2 bit
+// code and the few kmers containing other characters on their canonical form
+struct LocalHashTable {
+  std::unordered_map<uint64_t, std::vector<int>> codes;
+  HashTable other;
+};
+
+struct KmerCode;
+
 class SCCGC {
  public:
   SCCGC(std::string referenceGenomePath, std::string inputFilePath,
-        std::string outputDirPath)
+        std::string outputDirPath, long memoryBudget = 0)
       : referenceGenomePath(referenceGenomePath),
         inputFilePath(inputFilePath),
-        outputDirPath(outputDirPath){};
+        outputDirPath(outputDirPath),
+        memoryBudget(memoryBudget){};
   ~SCCGC(){};
   void run();
 
@@ -28,10 +50,20 @@ class SCCGC {
   std::string referenceSeq;
   int kmer_size;
   static const int segment_length = 30000;
+  static const int checksum_block = 1048576;  // target bytes per checksum
   static const int maxchar = 67108864;
-  static const int ght_maxlen = 268435456;  // max size of the global hash table
+  static const int ght_bits = 28;
+  static const int ght_maxlen = 1 << ght_bits;  // max size of the global hash table
+  static const int merge_fanin = 64;  // on-disk index runs merged at once
   std::vector<int> kmer_location;           // global hash table
   std::vector<int> next_kmer;  // linked list of kmers with the same hashcode
+  long memoryBudget;  // MB for the on-disk global index, 0 uses the table above
+  std::string diskIndexPath;
+  void* diskIndex = MAP_FAILED;  // mmapped on-disk global index
+  size_t diskIndexSize = 0;
+  int diskBits = 0;                      // log2 of on-disk index bucket count
+  const uint32_t* diskOffsets = nullptr;  // first entry of every bucket
+  const uint32_t* diskPositions = nullptr;
   float T1 = 0.5; // threshold for local matching
   int T2 = 4; // similarity threshold
   bool global = false;
@@ -39,10 +71,21 @@ class SCCGC {
   int lineLength;
 
   void buildGlobalHashTable(const string reference, int kmer_length);
-  HashTable makeLocalHashTable(const string reference, int kmer_length);
+  void buildDiskIndex(const string& reference, int kmer_length);
+  void mergeRuns(const std::vector<std::string>& runPaths,
+                 const std::function<void(uint64_t)>& emit);
+  void closeDiskIndex();
+  void globalCandidates(const KmerCode& code, const string& target, int j,
+                        int kmer_length, std::vector<int>& positions);
+  LocalHashTable makeLocalHashTable(const string reference, int kmer_length);
   std::vector<std::pair<int, int>> getLowercasePositions(const string input);
   std::vector<std::pair<int, int>> getNPositions(const string input);
 
+  long globalHashKey(const string& kmer);
+  int extendMatch(const string& target, const string& reference, int j,
+                  int pos, int kmer_length, bool reverse, int& start);
+  std::string matchSegment(const string& t_seg, const string& r_seg,
+                           long offset, int kmer_length);
   void matchLocal(const string target, const string reference, int kmer_length);
   void matchGlobal(const string target, const string reference,
                    int kmer_length);
@@ -70,7 +113,31 @@ int main(int argc, char** argv) {
   if (argc < 4) {
     std::cout << "Usage: " << argv[0]
               << " <reference genome file> <input file> <output_directory>"
-              << std::endl;
+              << " [--low-memory <MB>]" << std::endl;
+    return 1;
+  }
+
+  // optional RAM budget for the global index, which is then built on disk,
+  // capped at 1 TB so the size in bytes cannot overflow
+  const long max_memory_budget = 1L << 20;
+  long memoryBudget = 0;
+  for (int i = 4; i < argc; i++) {
+    if (std::string(argv[i]) == "--low-memory" && i + 1 < argc) {
+      char* end;
+      errno = 0;
+      memoryBudget = std::strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0' || errno == ERANGE ||
+          memoryBudget > max_memory_budget) {
+        memoryBudget = -1;
+      }
+    } else {
+      std::cout << "Error: Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (argc > 4 && memoryBudget <= 0) {
+    std::cout << "Error: Memory budget must be a number of MB between 1 and "
+              << max_memory_budget << std::endl;
     return 1;
   }
 
@@ -94,7 +161,7 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  SCCGC sccgc(argv[1], argv[2], argv[3]);
+  SCCGC sccgc(argv[1], argv[2], argv[3], memoryBudget);
 
   sccgc.run();
   return 0;
@@ -124,44 +191,79 @@ std::string parseReferenceGenome(std::string referenceGenomePath) {
   return referenceGenome;
 }
 
+// plain, gzip and BGZF compressed files are accepted
 std::string readReferenceGenome(std::string referenceGenomePath) {
-  ifstream referenceGenomeFile(referenceGenomePath);
+  string text;
   // check file opened successfully
-  if (!referenceGenomeFile.is_open()) {
+  if (!bgzf::readFile(referenceGenomePath, text)) {
     std::cout << "Error: Failed to open reference genome file" << std::endl;
     std::exit(1);
   }
 
-  string referenceGenome = "";
-  string line;
-  // skip first line
-  getline(referenceGenomeFile, line);
+  return fasta::sequence(text);
+}
 
-  while (getline(referenceGenomeFile, line)) {
-    referenceGenome += line;
+// lexicographically smaller of a kmer and its reverse complement, so both
+// strands of the same sequence share a hash table entry
+std::string canonicalKmer(const std::string& kmer) {
+  std::string rc = fasta::reverseComplement(kmer);
+  return rc < kmer ? rc : kmer;
+}
+
+// 2 bit code of a base, -1 for anything other than ACGT
+int baseCode(char c) {
+  switch (c) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
   }
+}
 
-  return referenceGenome;
+// bucket of a canonical 2 bit kmer code in an index of 2^bits buckets
+uint64_t diskBucket(uint64_t code, int bits) {
+  return (code * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
 }
 
-std::string readTargetGenome(std::string targetGenomePath) {
-  ifstream targetGenomeFile(targetGenomePath);
-  // check file opened successfully
-  if (!targetGenomeFile.is_open()) {
-    std::cout << "Error: Failed to open target genome file" << std::endl;
-    std::exit(1);
+// rolling forward and reverse complement 2 bit codes of the last kmer_length
+// bases added, valid only while none of them is outside ACGT
+struct KmerCode {
+  explicit KmerCode(int kmer_length)
+      : kmer_length(kmer_length), mask((1ULL << (2 * kmer_length)) - 1) {}
+
+  void add(char c) {
+    int code = baseCode(c);
+    if (code < 0) {
+      count = 0;
+      return;
+    }
+    forward = ((forward << 2) | code) & mask;
+    backward = (backward >> 2) | ((uint64_t)(3 - code) << (2 * kmer_length - 2));
+    count++;
   }
 
-  string targetGenome = "";
-  string line;
-  // skip first line
-  getline(targetGenomeFile, line);
+  void reset() { count = 0; }
+  bool valid() const { return count >= kmer_length; }
+  uint64_t canonical() const { return std::min(forward, backward); }
 
-  while (getline(targetGenomeFile, line)) {
-    targetGenome += line;
-  }
+  int kmer_length;
+  uint64_t mask;
+  uint64_t forward = 0;
+  uint64_t backward = 0;
+  int count = 0;
+};
 
-  return targetGenome;
+// rolls code over to the kmer at position j of seq, next is the first
+// position not yet added and only moves forward
+void rollKmer(KmerCode& code, const std::string& seq, int j, int& next) {
+  if (next < j) {
+    code.reset();
+    next = j;
+  }
+  while (next < j + code.kmer_length) {
+    code.add(seq[next++]);
+  }
 }
 
 void SCCGC::run() {
@@ -169,12 +271,12 @@ void SCCGC::run() {
 
   kmer_size = 21;
 
-  // open files
-  ifstream inputFile(this->inputFilePath);
+  // open files, gzip and BGZF input is decompressed in memory
+  std::string targetText;
   interimFilePath = outputDirPath + "/interim.txt";
   ofstream outputStream(outputDirPath + "/output.sccg");
 
-  if (!inputFile.is_open()) {
+  if (!bgzf::readFile(inputFilePath, targetText)) {
     std::cout << "Error: Failed to open input file" << std::endl;
     std::exit(1);
   }
@@ -184,12 +286,11 @@ void SCCGC::run() {
     std::exit(1);
   }
 
-  std::getline(inputFile, targetHeader);
-
-  std::string line;
-  std::getline(inputFile, line);
-  int lineLength = line.length();
-  inputFile.close();
+  // header and length of the first sequence line
+  size_t headerEnd = std::min(targetText.find('\n'), targetText.length());
+  targetHeader = targetText.substr(0, headerEnd);
+  size_t lineEnd = std::min(targetText.find('\n', headerEnd + 1), targetText.length());
+  int lineLength = std::max<long>((long)lineEnd - (long)headerEnd - 1, 0);
 
   // parse reference genome file
   cout << "Parsing reference sequence... " << std::endl;
@@ -198,11 +299,23 @@ void SCCGC::run() {
 
   // read target genome file
   cout << "Reading target sequence... " << std::endl;
-  string targetSeq = readTargetGenome(inputFilePath);
+  string targetSeq = fasta::sequence(targetText);
+  std::string().swap(targetText);
 
   //write target header and line length to output file
   outputStream << targetHeader << std::endl << lineLength << std::endl;
 
+  // write reference checksum, target length and checksums of the original
+  // target sequence so the decompressor can detect a wrong reference or
+  // corrupted output
+  outputStream << "crc32c "
+               << crc32c::checksum(referenceSeq.data(), referenceSeq.length())
+               << " " << checksum_block << " " << targetSeq.length();
+  for (uint32_t crc : crc32c::blockChecksums(targetSeq, checksum_block)) {
+    outputStream << " " << crc;
+  }
+  outputStream << std::endl;
+
   std::vector<std::pair<int, int>> lowercasePositions = getLowercasePositions(targetSeq);
   // convert target sequence to uppercase
   std::transform(targetSeq.begin(), targetSeq.end(), targetSeq.begin(), ::toupper);
@@ -213,14 +326,17 @@ void SCCGC::run() {
     outputStream << pos.first - temp_end << " " << pos.second - pos.first << " ";
     temp_end = pos.second;
   }
-  outputStream << std::endl << std::endl;
+  outputStream << std::endl;
 
   // local matching phase
   cout << "Local matching phase... " << std::endl;
   matchLocal(targetSeq, referenceSeq, kmer_size);
 
   if (!global) {
-  // write local matching result to output file
+    // N characters are stored as literals in local mode, leave N line empty
+    outputStream << std::endl;
+
+    // write local matching result to output file
     cout << "Postprocessing... " << std::endl;
     postprocess();
 
@@ -253,8 +369,18 @@ void SCCGC::run() {
     outputStream << pos.first << " " << pos.second << " ";
   }
   outputStream << std::endl;
-  
-  matchGlobal(targetSeq, referenceSeq, kmer_size);
+
+  // N runs are restored by the decompressor, match only the remaining bases
+  std::string strippedTarget;
+  strippedTarget.reserve(targetSeq.length());
+  int prevEnd = 0;
+  for (const auto& pos : nPositions) {
+    strippedTarget.append(targetSeq, prevEnd, pos.first - prevEnd);
+    prevEnd = pos.second;
+  }
+  strippedTarget.append(targetSeq, prevEnd, string::npos);
+
+  matchGlobal(strippedTarget, referenceSeq, kmer_size);
 
   cout << "Postprocessing... " << std::endl;
   postprocess();
@@ -287,32 +413,298 @@ void SCCGC::buildGlobalHashTable(const string reference, int kmer_length) {
   // set all hash table entries to default value
   std::fill(kmer_location.begin(), kmer_location.end(), -1);
 
-  // calculate hashcode for every kmer
+  // calculate hashcode for every canonical kmer
+  KmerCode code(kmer_length);
+  int next = 0;
   for (int i = 0; i < iters; i++) {
-    string kmer = reference.substr(i, kmer_length);
-    hash<string> hasher;
-    long key = labs(hasher(kmer)) % ght_maxlen;
+    rollKmer(code, reference, i, next);
+    long key = code.valid()
+                   ? (long)diskBucket(code.canonical(), ght_bits)
+                   : globalHashKey(canonicalKmer(reference.substr(i, kmer_length)));
 
     next_kmer[i] = kmer_location[static_cast<int>(key)];
     kmer_location[static_cast<int>(key)] = i;
   }
 }
 
+// Builds the global index on disk for machines that cannot hold the hash
+// table. (bucket, position) pairs are sorted in runs of at most memoryBudget
+// MB, spilled to the output directory and merged into a file holding bucket
+// offsets followed by the positions of every bucket, which is then mmapped.
+// Buckets are keyed on the canonical 2 bit kmer code, kmers with other
+// characters are not indexed.
+void SCCGC::buildDiskIndex(const string& reference, int kmer_length) {
+  long length = reference.length();
+  long iters = std::max(length - kmer_length + 1, 0L);
+  diskBits = 10;
+  while ((1L << diskBits) < iters / 2) {
+    diskBits++;
+  }
+  uint64_t buckets = 1ULL << diskBits;
+
+  size_t runCapacity =
+      std::max<size_t>((size_t)memoryBudget * 1024 * 1024 / 8, 1 << 16);
+  std::vector<uint64_t> run;
+  run.reserve(std::min<size_t>(runCapacity, iters));
+  std::vector<std::string> runPaths;
+  int runCount = 0;
+  auto nextRunPath = [&]() {
+    return outputDirPath + "/global_run_" + std::to_string(runCount++) + ".tmp";
+  };
+  auto spill = [&]() {
+    std::sort(run.begin(), run.end());
+    std::string runPath = nextRunPath();
+    std::ofstream runFile(runPath, std::ios::binary);
+    runFile.write((const char*)run.data(), run.size() * sizeof(uint64_t));
+    if (!runFile) {
+      std::cout << "Error: Failed to write index run " << runPath << std::endl;
+      std::exit(1);
+    }
+    runPaths.push_back(runPath);
+    run.clear();
+  };
+
+  KmerCode code(kmer_length);
+  uint64_t count = 0;
+  for (long i = 0; i < length; i++) {
+    code.add(reference[i]);
+    if (!code.valid()) {
+      continue;
+    }
+    uint64_t bucket = diskBucket(code.canonical(), diskBits);
+    run.push_back((bucket << 32) | (uint64_t)(i - kmer_length + 1));
+    count++;
+    if (run.size() == runCapacity) {
+      spill();
+    }
+  }
+  if (!run.empty()) {
+    spill();
+  }
+  std::vector<uint64_t>().swap(run);
+
+  // merge runs in groups until the final merge stays within merge_fanin open
+  // files
+  while (runPaths.size() > merge_fanin) {
+    std::vector<std::string> merged;
+    for (size_t first = 0; first < runPaths.size(); first += merge_fanin) {
+      size_t last = std::min(first + merge_fanin, runPaths.size());
+      std::vector<std::string> group(runPaths.begin() + first,
+                                     runPaths.begin() + last);
+      std::string runPath = nextRunPath();
+      std::ofstream runFile(runPath, std::ios::binary);
+      mergeRuns(group, [&runFile](uint64_t value) {
+        runFile.write((const char*)&value, sizeof(value));
+      });
+      runFile.close();
+      if (!runFile) {
+        std::cout << "Error: Failed to write index run " << runPath << std::endl;
+        std::exit(1);
+      }
+      for (const auto& path : group) {
+        std::remove(path.c_str());
+      }
+      merged.push_back(runPath);
+    }
+    runPaths.swap(merged);
+  }
+
+  // file layout: magic, bucket bits, entry count, offsets, positions
+  diskIndexPath = outputDirPath + "/global.idx";
+  size_t headerSize = 24;
+  size_t offsetsSize = (buckets + 1) * sizeof(uint32_t);
+  diskIndexSize = headerSize + offsetsSize + count * sizeof(uint32_t);
+  {
+    std::ofstream create(diskIndexPath, std::ios::binary);
+    uint64_t header[3] = {0, (uint64_t)diskBits, count};
+    std::memcpy(header, "SCCGI1\0\0", 8);
+    create.write((const char*)header, sizeof(header));
+  }
+  filesystem::resize_file(diskIndexPath, diskIndexSize);
+  std::fstream offsetStream(diskIndexPath,
+                            std::ios::binary | std::ios::in | std::ios::out);
+  std::fstream positionStream(diskIndexPath,
+                              std::ios::binary | std::ios::in | std::ios::out);
+  offsetStream.seekp(headerSize);
+  positionStream.seekp(headerSize + offsetsSize);
+
+  uint64_t bucket = 0;
+  uint32_t written = 0;
+  mergeRuns(runPaths, [&](uint64_t value) {
+    for (; bucket <= (value >> 32); bucket++) {
+      offsetStream.write((const char*)&written, sizeof(written));
+    }
+    uint32_t pos = (uint32_t)value;
+    positionStream.write((const char*)&pos, sizeof(pos));
+    written++;
+  });
+  for (; bucket <= buckets; bucket++) {
+    offsetStream.write((const char*)&written, sizeof(written));
+  }
+  offsetStream.close();
+  positionStream.close();
+  if (!offsetStream || !positionStream || written != count) {
+    std::cout << "Error: Failed to write global index" << std::endl;
+    std::exit(1);
+  }
+  for (const auto& runPath : runPaths) {
+    std::remove(runPath.c_str());
+  }
+
+  // serve lookups from the page cache instead of process memory
+  int fd = open(diskIndexPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cout << "Error: Failed to open global index" << std::endl;
+    std::exit(1);
+  }
+  diskIndex = mmap(nullptr, diskIndexSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (diskIndex == MAP_FAILED) {
+    std::cout << "Error: Failed to map global index" << std::endl;
+    std::exit(1);
+  }
+  madvise(diskIndex, diskIndexSize, MADV_RANDOM);
+  diskOffsets = (const uint32_t*)((const char*)diskIndex + headerSize);
+  diskPositions = diskOffsets + buckets + 1;
+}
+
+// k-way merge of sorted run files, passing every value to emit in order
+void SCCGC::mergeRuns(const std::vector<std::string>& runPaths,
+                      const std::function<void(uint64_t)>& emit) {
+  std::vector<std::ifstream> runFiles;
+  using Head = std::pair<uint64_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  for (const auto& runPath : runPaths) {
+    runFiles.emplace_back(runPath, std::ios::binary);
+    if (!runFiles.back().is_open()) {
+      std::cout << "Error: Failed to open index run " << runPath << std::endl;
+      std::exit(1);
+    }
+  }
+  for (size_t r = 0; r < runFiles.size(); r++) {
+    uint64_t value;
+    if (runFiles[r].read((char*)&value, sizeof(value))) {
+      heads.push(std::make_pair(value, r));
+    }
+  }
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    emit(head.first);
+
+    uint64_t value;
+    if (runFiles[head.second].read((char*)&value, sizeof(value))) {
+      heads.push(std::make_pair(value, head.second));
+    }
+  }
+  for (size_t r = 0; r < runFiles.size(); r++) {
+    if (runFiles[r].bad()) {
+      std::cout << "Error: Failed to read index run " << runPaths[r]
+                << std::endl;
+      std::exit(1);
+    }
+  }
+}
+
+void SCCGC::closeDiskIndex() {
+  if (diskIndex != MAP_FAILED) {
+    munmap(diskIndex, diskIndexSize);
+    diskIndex = MAP_FAILED;
+    std::remove(diskIndexPath.c_str());
+  }
+}
+
+// collects reference positions whose canonical kmer may equal the canonical
+// form of the kmer at target position j, hash collisions are rejected later by
+// extendMatch
+void SCCGC::globalCandidates(const KmerCode& code, const string& target, int j,
+                             int kmer_length, std::vector<int>& positions) {
+  positions.clear();
+  if (memoryBudget == 0) {
+    long key = code.valid()
+                   ? (long)diskBucket(code.canonical(), ght_bits)
+                   : globalHashKey(canonicalKmer(target.substr(j, kmer_length)));
+    for (int pos = kmer_location[key]; pos != -1; pos = next_kmer[pos]) {
+      positions.push_back(pos);
+    }
+    return;
+  }
+
+  // the on-disk index only holds kmers over ACGT
+  if (!code.valid()) {
+    return;
+  }
+  uint64_t bucket = diskBucket(code.canonical(), diskBits);
+  for (uint32_t o = diskOffsets[bucket]; o < diskOffsets[bucket + 1]; o++) {
+    positions.push_back(diskPositions[o]);
+  }
+}
+
+long SCCGC::globalHashKey(const string& kmer) {
+  hash<string> hasher;
+  return labs(hasher(kmer)) % ght_maxlen;
+}
+
 // expects preprocessed reference segment
-HashTable SCCGC::makeLocalHashTable(
+LocalHashTable SCCGC::makeLocalHashTable(
     const string reference, int kmer_length) {
-  HashTable kmer_location_map(reference.length() - kmer_length + 1, std::hash<std::string>{});
   int length = reference.length();
-  kmer_location_map.reserve(length - kmer_length + 1);
+  int iters = std::max(length - kmer_length + 1, 0);
+  LocalHashTable kmer_location_map;
+  kmer_location_map.codes.reserve(iters);
 
-  for (int i = 0; i < length - kmer_length + 1; i++) {
-    std::string current = reference.substr(i, kmer_length);
-    kmer_location_map[current].push_back(i);
+  // kmers are stored in canonical form so reverse complement hits are found
+  KmerCode code(kmer_length);
+  int next = 0;
+  for (int i = 0; i < iters; i++) {
+    rollKmer(code, reference, i, next);
+    if (code.valid()) {
+      kmer_location_map.codes[code.canonical()].push_back(i);
+    } else {
+      std::string current = canonicalKmer(reference.substr(i, kmer_length));
+      kmer_location_map.other[current].push_back(i);
+    }
   }
 
   return kmer_location_map;
 }
 
+// verifies a seed hit of the kmer at target position j against reference
+// position pos on the given strand and extends it as far as possible.
+// Returns the match length - 1 (-1 if the kmers differ) and sets start to the
+// leftmost reference position covered by the match.
+int SCCGC::extendMatch(const string& target, const string& reference, int j,
+                       int pos, int kmer_length, bool reverse, int& start) {
+  int t_len = target.length();
+  int r_len = reference.length();
+  int ext = 0;  // match extension length
+
+  if (!reverse) {
+    if (target.compare(j, kmer_length, reference, pos, kmer_length) != 0) {
+      return -1;
+    }
+    while (j + kmer_length + ext < t_len && pos + kmer_length + ext < r_len &&
+           reference[pos + kmer_length + ext] == target[j + kmer_length + ext]) {
+      ext++;
+    }
+    start = pos;
+    return kmer_length + ext - 1;
+  }
+
+  // target runs forwards while the reference runs backwards from the kmer end
+  for (int x = 0; x < kmer_length; x++) {
+    if (target[j + x] != fasta::complement(reference[pos + kmer_length - 1 - x])) {
+      return -1;
+    }
+  }
+  while (j + kmer_length + ext < t_len && pos - 1 - ext >= 0 &&
+         target[j + kmer_length + ext] == fasta::complement(reference[pos - 1 - ext])) {
+    ext++;
+  }
+  start = pos - ext;
+  return kmer_length + ext - 1;
+}
+
 // returns a vector of pairs of start and end positions of lowercase subsequences
 std::vector<std::pair<int, int>> SCCGC::getLowercasePositions(
     const string input) {
@@ -338,7 +730,7 @@ std::vector<std::pair<int, int>> SCCGC::getLowercasePositions(
 
   // check if the last subsequence is all lowercase
   if (multiple) {
-    positions.push_back(std::make_pair(start, input.length() - 1));
+    positions.push_back(std::make_pair(start, input.length()));
   }
   return positions;
 }
@@ -366,30 +758,67 @@ std::vector<std::pair<int, int>> SCCGC::getNPositions(const string input) {
 
   // check if the last subsequence is all N characters
   if (multiple) {
-    positions.push_back(std::make_pair(start, input.length() - 1));
+    positions.push_back(std::make_pair(start, input.length()));
   }
   return positions;
 }
 
- //global matching
-void SCCGC::matchGlobal(const string reference, const string target, int kmer_size) {
-  std::vector<std::pair<int, int>> nPositions = getNPositions(target);
-
-  std::ofstream interimFile("tempFile.txt");
-  for (const auto& pos : nPositions) {
-    interimFile << pos.first << " " << pos.second << std::endl;
+// global matching, expects target with N runs removed
+void SCCGC::matchGlobal(const string target, const string reference,
+                        int kmer_length) {
+  std::ofstream interimStream(interimFilePath);
+  if (memoryBudget > 0) {
+    cout << "Building on-disk global index... " << std::endl;
+    buildDiskIndex(reference, kmer_length);
+  } else {
+    buildGlobalHashTable(reference, kmer_length);
   }
-  interimFile.close();
 
-  std::string processedRef = reference;
-  std::string processedTarg = target;
+  std::vector<int> candidates;
+  KmerCode code(kmer_length);
+  int next = 0;
+  int length = target.length();
+  for (int j = 0; j < length; j++) {
+    if (length - j < kmer_length) {
+      interimStream << target[j];
+      continue;
+    }
+    rollKmer(code, target, j, next);
+    globalCandidates(code, target, j, kmer_length, candidates);
+    int longest_len = -1;
+    int longest_start = -1;
+    bool longest_reverse = false;
+    for (int pos : candidates) {
+      for (bool reverse : {false, true}) {
+        int start;
+        int len = extendMatch(target, reference, j, pos, kmer_length, reverse,
+                              start);
+        // if current match is longer than previous longest match, update
+        if (len > longest_len) {
+          longest_len = len;
+          longest_start = start;
+          longest_reverse = reverse;
+        }
+      }
+    }
+
+    if (longest_len == -1) {
+      interimStream << target[j];
+      continue;
+    }
 
-  for (const auto& pos : nPositions) {
-    processedRef.erase(pos.first, pos.second - pos.first + 1);
-    processedTarg.erase(pos.first, pos.second - pos.first + 1);
-  }
+    interimStream << endl << longest_start << "," << longest_start + longest_len;
+    if (longest_reverse) {
+      interimStream << ",r";
+    }
+    interimStream << endl;
 
-  buildGlobalHashTable(processedRef, kmer_size);
+    // update index to skip over longest match
+    j += longest_len;
+  }
+  interimStream << endl;
+  interimStream.close();
+  closeDiskIndex();
 }
 
 // local matching
@@ -414,62 +843,10 @@ void SCCGC::matchLocal(const string target, const string reference,
   for (int i = 0; i < num_segments; i++) {
     string t_seg = target.substr(i * segment_length, segment_length);
     string r_seg = reference.substr(i * segment_length, segment_length);
-    HashTable hashtable = makeLocalHashTable(r_seg, kmer_length);
-    std::ostringstream ss;
-    for (int j = 0; j < segment_length; j++) {
-      if (segment_length - j < kmer_length) {
-        ss << t_seg[j];
-        continue;
-      }
-      string kmer = t_seg.substr(j, kmer_length);
-      if (hashtable.count(kmer) > 0) { // check if key exists
-        vector<int> kmer_positions = hashtable[kmer];
-        int longest_len = -1;
-        int longest_pos = -1;
-        for (int pos : kmer_positions) {
-          if (t_seg.substr(j, kmer_length) == r_seg.substr(pos, kmer_length)) {
-            int ext = 0; // match extension length
-            // find longest match between target and reference 
-            while (j + kmer_length + ext < t_seg.length()
-                && pos + kmer_length + ext < r_seg.length()
-                && r_seg[pos + kmer_length + ext] == t_seg[j + kmer_length + ext]) {
-              ext++;
-            }
-            // if current match is longer than previous longest match, update
-            if (kmer_length + ext - 1 > longest_len) {
-              longest_len = kmer_length + ext - 1;
-              longest_pos = pos;
-            }
-          }
-        }
-
-        if (longest_len == -1) {
-          ss << t_seg[j];
-          continue;
-        }
-        
-        // write to file
-        if (j != 0) {
-          ss << endl;
-        }
-        int start = i*segment_length + longest_pos;
-        int end = start + longest_len;
-        ss << start << "," << end << endl;
-        // write the unmatched character at the end
-        if (longest_pos+longest_len + 1 < segment_length) {
-          ss << t_seg[longest_pos+longest_len+1];
-        }
-
-        // update index to skip over longest match and unmatched character
-        j += longest_len + 1;
-      } else {
-        // write unmatched character to file
-        ss << t_seg[j];
-      }
-    }
+    string ss = matchSegment(t_seg, r_seg, i * segment_length, kmer_length);
 
     // check ratio of directly stored characters
-    if (ss.str().length() > segment_length * T1 && !allN(t_seg)) {
+    if (ss.length() > segment_length * T1 && !allN(t_seg)) {
       unmatched_segments++;
     }
 
@@ -482,53 +859,92 @@ void SCCGC::matchLocal(const string target, const string reference,
       return;
     }
 
-    // write newline to file after segment
-    // interimStream.write(ss.str().c_str(), ss.str().length());
-    interimStream << ss.str();
+    interimStream << ss;
     interimStream.flush();
   }
 
   // last segment
-  string t_seg = target.substr(num_segments * segment_length, target.length() - num_segments * segment_length);
-  string r_seg = reference.substr(num_segments * segment_length, reference.length() - num_segments * segment_length);
-  HashTable hashtable = makeLocalHashTable(r_seg, kmer_length);
-  for (int j = 0; j < t_seg.length() - kmer_length + 1; j++) {
-    string kmer = t_seg.substr(j, kmer_length);
-    if (hashtable.count(kmer) > 0) { // check if key exists
-      vector<int> kmer_positions = hashtable[kmer];
-      int longest_len = 0;
-      int longest_pos = 0;
-      for (int pos : kmer_positions) {
-        int ext = 0; // match extension length
-        // find longest match between target and reference 
-        while (j + kmer_length + ext < t_seg.length()
-            && pos + kmer_length + ext < r_seg.length()
-            && r_seg[pos + kmer_length + ext] ==  t_seg[j + kmer_length + ext]) {
-          ext++;
-        }
+  string t_seg = target.substr(num_segments * segment_length);
+  string r_seg = reference.substr(num_segments * segment_length);
+  interimStream << matchSegment(t_seg, r_seg, num_segments * segment_length,
+                                kmer_length);
+  interimStream << endl;
+  interimStream.close();
+}
+
+// matches a target segment against the reference segment at the same offset.
+// Unmatched characters are written as literals, matches as absolute
+// "start,end" reference positions followed by ",r" for reverse complement.
+std::string SCCGC::matchSegment(const string& t_seg, const string& r_seg,
+                                long offset, int kmer_length) {
+  LocalHashTable hashtable = makeLocalHashTable(r_seg, kmer_length);
+  std::ostringstream ss;
+  KmerCode code(kmer_length);
+  int next = 0;
+  int length = t_seg.length();
+  for (int j = 0; j < length; j++) {
+    if (length - j < kmer_length) {
+      ss << t_seg[j];
+      continue;
+    }
+    rollKmer(code, t_seg, j, next);
+    const std::vector<int>* hits = nullptr;
+    if (code.valid()) {
+      auto it = hashtable.codes.find(code.canonical());
+      if (it != hashtable.codes.end()) {
+        hits = &it->second;
+      }
+    } else {
+      auto it = hashtable.other.find(canonicalKmer(t_seg.substr(j, kmer_length)));
+      if (it != hashtable.other.end()) {
+        hits = &it->second;
+      }
+    }
+    if (hits == nullptr) {
+      // write unmatched character to file
+      ss << t_seg[j];
+      continue;
+    }
+
+    int longest_len = -1;
+    int longest_start = -1;
+    bool longest_reverse = false;
+    for (int pos : *hits) {
+      // forward strand is tried first so it wins ties
+      for (bool reverse : {false, true}) {
+        int start;
+        int len = extendMatch(t_seg, r_seg, j, pos, kmer_length, reverse, start);
         // if current match is longer than previous longest match, update
-        if (kmer_length + ext - 1 > longest_len) {
-          longest_len = kmer_length + ext - 1;
-          longest_pos = pos;
+        if (len > longest_len) {
+          longest_len = len;
+          longest_start = start;
+          longest_reverse = reverse;
         }
       }
+    }
 
-      // write to file
-      if (j != 0) {
-        interimStream << endl;
-      }
-      int start = num_segments*segment_length + longest_pos;
-      int end = start + longest_len;
-      interimStream <<  start << "," << end << endl;
+    if (longest_len == -1) {
+      ss << t_seg[j];
+      continue;
+    }
 
-      // update index to skip over longest match
-      j += longest_len - 1;
-    } else {
-      interimStream << t_seg[j];
+    // write to file
+    int start = offset + longest_start;
+    int end = start + longest_len;
+    ss << endl << start << "," << end;
+    if (longest_reverse) {
+      ss << ",r";
     }
+    ss << endl;
+    // write the unmatched character at the end
+    if (j + longest_len + 1 < length) {
+      ss << t_seg[j + longest_len + 1];
+    }
+
+    // update index to skip over longest match and unmatched character
+    j += longest_len + 1;
   }
-  interimStream << endl;
-  interimStream.close();
+  return ss.str();
 }
 
 void SCCGC::run7zip(const string filename) {
@@ -541,45 +957,64 @@ void SCCGC::postprocess() {
   
   std::ifstream interimStream(interimFilePath);
   std::string line;
-  std::vector<int> positions;
   std::stringstream ss;
 
-  // merge continuous matches
+  // merge continuous matches, reverse complement matches continue towards
+  // lower reference positions
+  bool open = false;
+  int m_start = 0;
+  int m_end = 0;
+  bool m_reverse = false;
   while (std::getline(interimStream, line)) {
     if (line.find(',') != std::string::npos) {
       int start = stoi(line.substr(0, line.find(',')));
       int end = stoi(line.substr(line.find(',') + 1));
-      if (positions.size() > 0) {
-        if (start != positions.back() + 1) {
-          ss << start << "," << end << std::endl;
-          positions.clear();
+      bool reverse = line.find(",r") != std::string::npos;
+      if (open && reverse == m_reverse) {
+        if (!reverse && start == m_end + 1) {
+          m_end = end;
+          continue;
         }
+        if (reverse && end == m_start - 1) {
+          m_start = start;
+          continue;
+        }
+      }
+      if (open) {
+        ss << m_start << "," << m_end << (m_reverse ? ",r" : "") << std::endl;
       }
-      positions.push_back(start);
-      positions.push_back(end);
+      open = true;
+      m_start = start;
+      m_end = end;
+      m_reverse = reverse;
     } else if (line.length() > 0) {
-      if (positions.size() > 0) {
-        ss << positions.front() << "," << positions.back() << std::endl;
-        positions.clear();
+      if (open) {
+        ss << m_start << "," << m_end << (m_reverse ? ",r" : "") << std::endl;
+        open = false;
       }
       ss << line << std::endl;
     }
   }
-  if (positions.size() > 0) {
-    ss << positions.front() << "," << positions.back() << std::endl;
+  if (open) {
+    ss << m_start << "," << m_end << (m_reverse ? ",r" : "") << std::endl;
   }
   interimStream.close();
 
-  // delta encoding
+  // delta encoding, forward matches are relative to the previous match end
+  // and reverse complement matches count backwards from it
   std::stringstream oss;
-  bool successive = false;
   int prev = 0;
   while (std::getline(ss, line)) {
     if (line.find(',') != std::string::npos) {
       int start = stoi(line.substr(0, line.find(',')));
       int end = stoi(line.substr(line.find(',') + 1));
-      oss << start - prev << "," << end - start << std::endl;
-      prev = end;
+      if (line.find(",r") != std::string::npos) {
+        oss << prev - end << "," << end - start << ",r" << std::endl;
+        prev = start;
+      } else {
+        oss << start - prev << "," << end - start << std::endl;
+        prev = end;
+      }
     } else if (line.length() > 0) {
       oss << line << std::endl;
     }
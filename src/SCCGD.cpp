@@ -2,29 +2,81 @@
 #include <filesystem>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <vector>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "bgzf.h"
+#include "fasta.h"
+#include "crc32c.h"
+
 using namespace std;
 
 class SCCGD {
   public:
     SCCGD(std::string referenceGenomePath, std::string inputFilePath,
-        std::string outputDirPath)
+        std::string outputDirPath, bool bgzfOutput = false)
       : referenceGenomePath(referenceGenomePath),
         inputFilePath(inputFilePath),
-        outputDirPath(outputDirPath){};
+        outputDirPath(outputDirPath),
+        bgzfOutput(bgzfOutput){};
   
     void run();
+    void stats();
+    void verify();
   
   private:
+    // reference summary used by stats mode. GC counts are stored as a prefix
+    // sum every 64 bases plus a bitmask of GC positions inside each block,
+    // and N runs as sorted [start, end) pairs. The reference file size and
+    // sequence checksum identify the reference the index was built from.
+    struct PrefixIndex {
+      uint64_t length;
+      uint32_t checksum;
+      uint64_t blocks;
+      uint64_t nRuns;
+      const uint64_t* gcMask;
+      const uint32_t* gcPrefix;
+      const uint32_t* nRunBounds;
+    };
+
     const string referenceGenomePath;
     const string inputFilePath;
     const string outputDirPath;
+    const bool bgzfOutput;  // write output.txt.gz instead of output.txt
     string targetHeader;
     int lineLength;
+    std::vector<std::pair<int, int>> lpos;  // lowercase (delta, length) pairs
+    std::vector<std::pair<int, int>> npos;  // N run [start, end) pairs
+    std::string prefixBuffer;  // prefix index when it could not be mapped
+    std::ostream* progress = &std::cout;  // stderr when stdout holds results
+    bool hasChecksums = false;  // archives made before checksums lack them
+    uint32_t referenceChecksum = 0;
+    size_t checksumBlock = 0;  // target bytes per block checksum
+    size_t targetLength = 0;
+    std::vector<uint32_t> blockChecksums;
 
     std::string readReferenceGenome(std::string referenceGenomePath);
+    void readHeader(std::istream& inputFile);
+    std::string reconstruct(std::istream& inputFile,
+                            const std::string& referenceSeq);
+    void checkReference(const std::string& referenceSeq);
+    void checkBlocks(const std::string& target);
+    bool parseMatch(const std::string& line, int& prevEnd, int& refStart,
+                    int& length, bool& reverse);
+    std::string buildPrefixIndex(const std::string& referenceSeq,
+                                 uint64_t fileSize);
+    const char* mapPrefixIndex(const std::string& indexPath, uint64_t fileSize);
+    PrefixIndex loadPrefixIndex();
+    uint64_t gcBefore(const PrefixIndex& index, uint64_t pos);
 };
 
 
@@ -35,20 +87,74 @@ unsigned long long getMemoryUsageInKB() {
     return resident * (unsigned long long)getpagesize() / 1024;
 }
 
-void printMemoryUsage() {
+void printMemoryUsage(std::ostream& out = cout) {
   long long memusage = getMemoryUsageInKB();
-  cout << "Memory usage: " << memusage << " KB" << endl;
+  out << "Memory usage: " << memusage << " KB" << endl;
+}
+
+// parses a decimal int at the start of text and sets end past it, returns
+// false if there is none or it is out of range
+bool parseInt(const char* text, const char*& end, int& value) {
+  char* stop;
+  errno = 0;
+  long parsed = std::strtol(text, &stop, 10);
+  if (stop == text || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) {
+    return false;
+  }
+  end = stop;
+  value = parsed;
+  return true;
 }
 
 int main(int argc, char** argv) {
+  // stats mode reports sequence statistics without decompressing, verify
+  // mode checks the archive against its checksums without writing output
+  std::string mode = argc >= 2 ? argv[1] : "";
+  if (mode == "stats" || mode == "verify") {
+    if (argc < 4) {
+      std::cout << "Usage: " << argv[0] << " " << mode
+                << " <reference genome file> <input file>" << std::endl;
+      return 1;
+    }
+
+    if (!filesystem::exists(argv[2])) {
+      std::cout << "Error: Reference genome file does not exist: " << argv[2]
+                << std::endl;
+      return 1;
+    }
+
+    if (!filesystem::exists(argv[3])) {
+      std::cout << "Error: Input file does not exist: " << argv[3] << std::endl;
+      return 1;
+    }
+
+    SCCGD sccgd(argv[2], argv[3], "");
+    if (mode == "stats") {
+      sccgd.stats();
+    } else {
+      sccgd.verify();
+    }
+    return 0;
+  }
+
   // check number of arguments
   if (argc < 4) {
     std::cout << "Usage: " << argv[0]
               << " <reference genome file> <input file> <output_directory>"
-              << std::endl;
+              << " [--bgzf]" << std::endl;
     return 1;
   }
 
+  bool bgzfOutput = false;
+  for (int i = 4; i < argc; i++) {
+    if (std::string(argv[i]) == "--bgzf") {
+      bgzfOutput = true;
+    } else {
+      std::cout << "Error: Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
   // check reference genome file exists
   if (!std::filesystem::exists(argv[1])) {
     std::cout << "Error: Reference genome file does not exist: " << argv[1]
@@ -69,7 +175,7 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  SCCGD sccgd(argv[1], argv[2], argv[3]);
+  SCCGD sccgd(argv[1], argv[2], argv[3], bgzfOutput);
 
   sccgd.run();
   return 0;
@@ -79,10 +185,7 @@ void SCCGD::run() {
   std::cout << "Running SCCGD" << std::endl;
 
   std::string referenceSeq = readReferenceGenome(referenceGenomePath);
-
-  std::ofstream interimFile(outputDirPath + "/interim.txt");
-
-  std::ofstream outputFile(outputDirPath + "/output.txt");
+  std::transform(referenceSeq.begin(), referenceSeq.end(), referenceSeq.begin(), ::toupper);
 
   // read input file
   std::ifstream inputFile(inputFilePath);
@@ -92,83 +195,533 @@ void SCCGD::run() {
     std::exit(1);
   }
 
-  if (!outputFile.is_open()) {
+  // read header, lowercase and N positions
+  readHeader(inputFile);
+  checkReference(referenceSeq);
+  std::string targetUncompressed = reconstruct(inputFile, referenceSeq);
+
+  // output files are only opened, and so truncated, once the checksums
+  // have been verified
+  checkBlocks(targetUncompressed);
+
+  std::ofstream interimFile(outputDirPath + "/interim.txt");
+
+  // BGZF output is compressed batch by batch while it is written
+  std::string outputPath = outputDirPath + (bgzfOutput ? "/output.txt.gz" : "/output.txt");
+  std::ofstream outputFile;
+  bgzf::Writer bgzfWriter;
+  bool outputOpen = bgzfOutput ? bgzfWriter.open(outputPath)
+                               : (outputFile.open(outputPath), outputFile.is_open());
+  if (!outputOpen) {
     std::cout << "Error: Failed to open output file" << std::endl;
     std::exit(1);
   }
 
-  // read header
+  // lines are collected into chunks of about one BGZF block
+  auto writeChunk = [&](const std::string& chunk) {
+    bool ok = bgzfOutput ? bgzfWriter.write(chunk)
+                         : (bool)outputFile.write(chunk.data(), chunk.size());
+    if (!ok) {
+      std::cout << "Error: Failed to write output file" << std::endl;
+      std::exit(1);
+    }
+  };
+
+  std::string chunk = targetHeader + '\n';
+  for (size_t i = 0; i < targetUncompressed.length(); i += lineLength) {
+    chunk.append(targetUncompressed, i, lineLength);
+    chunk += '\n';
+    if (chunk.size() >= bgzf::block_input) {
+      writeChunk(chunk);
+      chunk.clear();
+    }
+  }
+  writeChunk(chunk);
+
+  if (bgzfOutput && !bgzfWriter.close()) {
+    std::cout << "Error: Failed to write output file" << std::endl;
+    std::exit(1);
+  }
+}
+
+void SCCGD::verify() {
+  progress = &std::cerr;
+  *progress << "Verifying archive" << std::endl;
+
+  std::ifstream inputFile(inputFilePath);
+  if (!inputFile.is_open()) {
+    std::cout << "Error: Failed to open input file" << std::endl;
+    std::exit(1);
+  }
+
+  std::string referenceSeq = readReferenceGenome(referenceGenomePath);
+  std::transform(referenceSeq.begin(), referenceSeq.end(), referenceSeq.begin(), ::toupper);
+
+  readHeader(inputFile);
+  if (!hasChecksums) {
+    std::cout << "Error: Archive has no checksums" << std::endl;
+    std::exit(1);
+  }
+  checkReference(referenceSeq);
+  std::string targetUncompressed = reconstruct(inputFile, referenceSeq);
+  checkBlocks(targetUncompressed);
+
+  cout << "Archive OK: " << targetUncompressed.length() << " bases in "
+       << blockChecksums.size() << " blocks verified" << endl;
+}
+
+void SCCGD::readHeader(std::istream& inputFile) {
   getline(inputFile, targetHeader);
   string line;
   getline(inputFile, line);
-  lineLength = stoi(line);
-  outputFile << targetHeader << std::endl;
+  const char* end;
+  if (!parseInt(line.c_str(), end, lineLength) || *end != '\0' ||
+      lineLength <= 0) {
+    std::cout << "Error: Corrupt header in archive" << std::endl;
+    std::exit(1);
+  }
 
-  // read lowercase positions
-  cout << "Reading lowercase positions..." << endl;
+  // read checksums, the line is missing in older archives
   std::string lowercasePositions;
   getline(inputFile, lowercasePositions);
+  if (lowercasePositions.rfind("crc32c ", 0) == 0) {
+    std::istringstream css(lowercasePositions.substr(7));
+    uint32_t crc;
+    css >> referenceChecksum >> checksumBlock >> targetLength;
+    while (css >> crc) {
+      blockChecksums.push_back(crc);
+    }
+    hasChecksums = checksumBlock > 0;
+    // reject a damaged checksum line before anything is reconstructed,
+    // archive positions are ints so longer targets cannot be valid
+    if (hasChecksums &&
+        (targetLength > INT_MAX || checksumBlock > INT_MAX ||
+         blockChecksums.size() !=
+             (targetLength + checksumBlock - 1) / checksumBlock)) {
+      std::cout << "Error: Corrupt checksum line in archive" << std::endl;
+      std::exit(1);
+    }
+    getline(inputFile, lowercasePositions);
+  }
+
+  // read lowercase positions
+  *progress << "Reading lowercase positions..." << endl;
   std::istringstream iss(lowercasePositions);
   int start, length;
-  std::vector<std::pair<int, int>> lpos;
   while (iss >> start >> length) {
     lpos.push_back(std::make_pair(start, length));
   }
 
   // read N positions
-  cout << "Reading N positions..." << endl;
+  *progress << "Reading N positions..." << endl;
   std::string NPositions;
   getline(inputFile, NPositions);
+  std::istringstream nss(NPositions);
+  int nend;
+  while (nss >> start >> nend) {
+    npos.push_back(std::make_pair(start, nend));
+  }
+}
 
-  // read target sequence
-  cout << "Reading target sequence..." << endl;
+// rebuilds the target sequence from the match records, N runs and lowercase
+// positions
+std::string SCCGD::reconstruct(std::istream& inputFile,
+                               const std::string& referenceSeq) {
+  *progress << "Reading target sequence..." << endl;
   std::string targetUncompressed = "";
+  if (hasChecksums) {
+    targetUncompressed.reserve(targetLength);
+  }
   std::string targetSeq;
   int prevEnd = 0;
+  int refStart, length;
+  bool reverse;
   while (getline(inputFile, targetSeq)) {
-    if (targetSeq.find(',') != std::string::npos) {
-      int start = stoi(targetSeq.substr(0, targetSeq.find(',')));
-      int subseq_len = stoi(targetSeq.substr(targetSeq.find(',') + 1));
-      targetUncompressed += referenceSeq.substr(prevEnd + start, subseq_len);
-      prevEnd += start + subseq_len;
+    if (parseMatch(targetSeq, prevEnd, refStart, length, reverse)) {
+      if (refStart < 0 || length < 0 ||
+          (size_t)refStart + length > referenceSeq.length()) {
+        std::cout << "Error: Match record outside of reference" << std::endl;
+        std::exit(1);
+      }
+      size_t at = targetUncompressed.length();
+      targetUncompressed.append(referenceSeq, refStart, length);
+      if (reverse) {
+        std::reverse(targetUncompressed.begin() + at, targetUncompressed.end());
+        for (size_t i = at; i < targetUncompressed.length(); i++) {
+          targetUncompressed[i] = fasta::complement(targetUncompressed[i]);
+        }
+      }
     } else {
       targetUncompressed += targetSeq;
     }
+    // records never decode to more than the original length
+    if (hasChecksums && targetUncompressed.length() > targetLength) {
+      std::cout << "Error: Decompressed length does not match the archive"
+                << std::endl;
+      std::exit(1);
+    }
   }
 
-  printMemoryUsage();
+  printMemoryUsage(*progress);
+
+  // restore N runs removed in global matching mode
+  *progress << "Inserting N positions..." << endl;
+  for (auto pos : npos) {
+    if (pos.first < 0 || pos.second < pos.first ||
+        (size_t)pos.first > targetUncompressed.length()) {
+      std::cout << "Error: N run outside of target sequence" << std::endl;
+      std::exit(1);
+    }
+    targetUncompressed.insert(pos.first, pos.second - pos.first, 'N');
+  }
 
   // to lowercase
-  cout << "Updating lowercase positions..." << endl;
+  *progress << "Updating lowercase positions..." << endl;
   int offset = 0;
   for (auto pos : lpos) {
+    if (pos.first < 0 || pos.second < 0 ||
+        (size_t)(offset + pos.first + pos.second) > targetUncompressed.length()) {
+      std::cout << "Error: Lowercase run outside of target sequence" << std::endl;
+      std::exit(1);
+    }
     for (int i = pos.first; i < pos.first + pos.second; i++) {
       targetUncompressed[offset + i] = tolower(targetUncompressed[offset + i]);
     }
     offset += pos.first + pos.second;
   }
+  return targetUncompressed;
+}
 
-  for (int i = 0; i < targetUncompressed.length(); i += lineLength) {
-    outputFile << targetUncompressed.substr(i, lineLength) << std::endl;
+void SCCGD::checkReference(const std::string& referenceSeq) {
+  if (!hasChecksums) {
+    *progress << "Warning: Archive has no checksums, skipping verification" << endl;
+    return;
+  }
+  if (crc32c::checksum(referenceSeq.data(), referenceSeq.length()) !=
+      referenceChecksum) {
+    std::cout << "Error: Reference genome does not match the archive"
+              << std::endl;
+    std::exit(1);
   }
 }
 
-std::string SCCGD::readReferenceGenome(std::string referenceGenomePath) {
-  ifstream referenceGenomeFile(referenceGenomePath);
-  // check file opened successfully
-  if (!referenceGenomeFile.is_open()) {
-    std::cout << "Error: Failed to open referencreade genome file" << std::endl;
+void SCCGD::checkBlocks(const std::string& target) {
+  if (!hasChecksums) {
+    return;
+  }
+  *progress << "Verifying checksums..." << endl;
+  if (target.length() != targetLength) {
+    std::cout << "Error: Decompressed length does not match the archive"
+              << std::endl;
     std::exit(1);
   }
+  std::vector<uint32_t> checksums =
+      crc32c::blockChecksums(target, checksumBlock);
+  for (size_t b = 0; b < checksums.size(); b++) {
+    if (checksums[b] != blockChecksums[b]) {
+      std::cout << "Error: Checksum mismatch in block " << b << " (bytes "
+                << b * checksumBlock << "-"
+                << std::min((b + 1) * checksumBlock, target.length())
+                << ")" << std::endl;
+      std::exit(1);
+    }
+  }
+}
 
-  string referenceGenome = "";
-  string line;
-  // skip first line
-  getline(referenceGenomeFile, line);
+// decodes a "delta,length[,r]" match record into the reference range it
+// copies, returns false for literal lines and exits on malformed records
+bool SCCGD::parseMatch(const std::string& line, int& prevEnd, int& refStart,
+                       int& length, bool& reverse) {
+  if (line.find(',') == std::string::npos) {
+    return false;
+  }
+  const char* end;
+  int start, subseq_len;
+  bool ok = parseInt(line.c_str(), end, start) && *end == ',' &&
+            parseInt(end + 1, end, subseq_len) && subseq_len >= 0;
+  reverse = ok && std::strcmp(end, ",r") == 0;
+  long first = reverse ? (long)prevEnd - start - subseq_len
+                       : (long)prevEnd + start;
+  if (!ok || (*end != '\0' && !reverse) || first < INT_MIN ||
+      first + subseq_len > INT_MAX) {
+    std::cout << "Error: Corrupt record in archive" << std::endl;
+    std::exit(1);
+  }
+  length = subseq_len + 1;
+  refStart = first;
+  // reverse complement matches count backwards from the previous end
+  prevEnd = reverse ? refStart : refStart + subseq_len;
+  return true;
+}
+
+void SCCGD::stats() {
+  progress = &std::cerr;
+  std::ifstream inputFile(inputFilePath);
+  if (!inputFile.is_open()) {
+    std::cout << "Error: Failed to open input file" << std::endl;
+    std::exit(1);
+  }
+
+  readHeader(inputFile);
+  PrefixIndex index = loadPrefixIndex();
+  if (hasChecksums && index.checksum != referenceChecksum) {
+    std::cout << "Error: Reference genome does not match the archive"
+              << std::endl;
+    std::exit(1);
+  }
+
+  // N runs from the records are collected in record order and merged later
+  uint64_t length = 0;
+  uint64_t gc = 0;
+  std::vector<std::pair<uint64_t, uint64_t>> runs;
+  auto addRun = [&runs](uint64_t start, uint64_t end) {
+    if (!runs.empty() && runs.back().second == start) {
+      runs.back().second = end;
+    } else {
+      runs.push_back(std::make_pair(start, end));
+    }
+  };
+
+  std::string line;
+  int prevEnd = 0;
+  int refStart, matchLength;
+  bool reverse;
+  while (getline(inputFile, line)) {
+    if (parseMatch(line, prevEnd, refStart, matchLength, reverse)) {
+      uint64_t refEnd = refStart + matchLength;
+      if (refStart < 0 || refEnd > index.length) {
+        std::cout << "Error: Match record outside of reference" << std::endl;
+        std::exit(1);
+      }
+      // complementing swaps G and C, so counts do not depend on strand
+      gc += gcBefore(index, refEnd) - gcBefore(index, refStart);
+
+      // N runs of the reference range, mirrored for reverse complement
+      std::vector<std::pair<uint64_t, uint64_t>> matchRuns;
+      const uint32_t* bounds = index.nRunBounds;
+      uint64_t lo = 0, hi = index.nRuns;
+      while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (bounds[2 * mid + 1] <= (uint64_t)refStart) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      for (uint64_t r = lo; r < index.nRuns && bounds[2 * r] < refEnd; r++) {
+        uint64_t a = std::max<uint64_t>(bounds[2 * r], refStart);
+        uint64_t b = std::min<uint64_t>(bounds[2 * r + 1], refEnd);
+        if (reverse) {
+          matchRuns.push_back(
+              std::make_pair(length + refEnd - b, length + refEnd - a));
+        } else {
+          matchRuns.push_back(
+              std::make_pair(length + a - refStart, length + b - refStart));
+        }
+      }
+      if (reverse) {
+        std::reverse(matchRuns.begin(), matchRuns.end());
+      }
+      for (const auto& run : matchRuns) {
+        addRun(run.first, run.second);
+      }
+      length += matchLength;
+    } else {
+      for (char c : line) {
+        if (c == 'G' || c == 'C') {
+          gc++;
+        } else if (c == 'N') {
+          addRun(length, length + 1);
+        }
+        length++;
+      }
+    }
+  }
+
+  // N runs removed in global matching mode shift the record coordinates
+  std::vector<std::pair<uint64_t, uint64_t>> recordRuns;
+  recordRuns.swap(runs);
+  uint64_t shift = 0;
+  size_t next = 0;
+  for (const auto& run : recordRuns) {
+    while (next < npos.size() && (uint64_t)npos[next].first <= run.first + shift) {
+      addRun(npos[next].first, npos[next].second);
+      shift += npos[next].second - npos[next].first;
+      next++;
+    }
+    addRun(run.first + shift, run.second + shift);
+  }
+  for (; next < npos.size(); next++) {
+    addRun(npos[next].first, npos[next].second);
+    length += npos[next].second - npos[next].first;
+  }
+  length += shift;
+
+  uint64_t nCount = 0;
+  uint64_t longestRun = 0;
+  for (const auto& run : runs) {
+    nCount += run.second - run.first;
+    longestRun = std::max(longestRun, run.second - run.first);
+  }
+
+  uint64_t lowercase = 0;
+  for (const auto& pos : lpos) {
+    lowercase += pos.second;
+  }
+
+  if (hasChecksums && length != targetLength) {
+    std::cout << "Error: Decompressed length does not match the archive"
+              << std::endl;
+    std::exit(1);
+  }
+
+  uint64_t bases = length - nCount;
+  cout << "Header: " << targetHeader << endl;
+  cout << "Length: " << length << endl;
+  cout << "GC content: " << gc << " (" << (bases ? 100.0 * gc / bases : 0)
+       << "% of non-N bases)" << endl;
+  cout << "N runs: " << runs.size() << ", total " << nCount << ", longest "
+       << longestRun << endl;
+  cout << "Lowercase: " << lowercase << " ("
+       << (length ? 100.0 * lowercase / length : 0) << "%)" << endl;
+}
+
+// serializes the prefix index of an uppercase reference sequence
+std::string SCCGD::buildPrefixIndex(const std::string& referenceSeq,
+                                    uint64_t fileSize) {
+  uint64_t length = referenceSeq.length();
+  uint64_t blocks = (length + 63) / 64;
+  std::vector<uint64_t> gcMask(blocks, 0);
+  std::vector<uint32_t> gcPrefix(blocks + 1, 0);
+  std::vector<uint32_t> nRunBounds;
+
+  for (uint64_t i = 0; i < length; i++) {
+    char c = referenceSeq[i];
+    if (c == 'G' || c == 'C') {
+      gcMask[i / 64] |= 1ULL << (i % 64);
+    } else if (c == 'N') {
+      if (!nRunBounds.empty() && nRunBounds.back() == i) {
+        nRunBounds.back() = i + 1;
+      } else {
+        nRunBounds.push_back(i);
+        nRunBounds.push_back(i + 1);
+      }
+    }
+  }
+  for (uint64_t b = 0; b < blocks; b++) {
+    gcPrefix[b + 1] = gcPrefix[b] + __builtin_popcountll(gcMask[b]);
+  }
+
+  // header, then 8 byte aligned arrays followed by the 4 byte ones
+  uint64_t nRuns = nRunBounds.size() / 2;
+  uint64_t checksum = crc32c::checksum(referenceSeq.data(), length);
+  uint64_t header[6] = {0, fileSize, length, checksum, blocks, nRuns};
+  std::memcpy(header, "SCCGP2\0\0", 8);
+  std::string buffer;
+  buffer.append((const char*)header, sizeof(header));
+  buffer.append((const char*)gcMask.data(), gcMask.size() * 8);
+  buffer.append((const char*)gcPrefix.data(), gcPrefix.size() * 4);
+  buffer.append((const char*)nRunBounds.data(), nRunBounds.size() * 4);
+  return buffer;
+}
+
+// maps an existing prefix index, returns nullptr if it is missing, older than
+// the reference, built from a reference file of another size or truncated
+const char* SCCGD::mapPrefixIndex(const std::string& indexPath,
+                                  uint64_t fileSize) {
+  std::error_code ec;
+  if (!filesystem::exists(indexPath, ec) ||
+      filesystem::last_write_time(indexPath, ec) <
+          filesystem::last_write_time(referenceGenomePath, ec)) {
+    return nullptr;
+  }
+
+  int fd = open(indexPath.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < 48) {
+    close(fd);
+    return nullptr;
+  }
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+
+  const uint64_t* header = (const uint64_t*)mapped;
+  uint64_t blocks = header[4];
+  uint64_t nRuns = header[5];
+  bool valid = std::memcmp(mapped, "SCCGP2", 6) == 0 &&
+               header[1] == fileSize && blocks == (header[2] + 63) / 64 &&
+               nRuns <= header[2] &&
+               (uint64_t)st.st_size == 48 + 8 * blocks + 4 * (blocks + 1) + 8 * nRuns;
+  if (!valid) {
+    munmap(mapped, st.st_size);
+    return nullptr;
+  }
+  return (const char*)mapped;
+}
+
+// maps the prefix index stored next to the reference, building it from the
+// reference first if it is missing, stale or was built from a different
+// reference than the archive
+SCCGD::PrefixIndex SCCGD::loadPrefixIndex() {
+  std::string indexPath = referenceGenomePath + ".sccgp";
+  std::error_code ec;
+  uint64_t fileSize = filesystem::file_size(referenceGenomePath, ec);
+
+  const char* data = mapPrefixIndex(indexPath, fileSize);
+  if (data != nullptr && hasChecksums &&
+      ((const uint64_t*)data)[3] != referenceChecksum) {
+    data = nullptr;
+  }
+  if (data == nullptr) {
+    *progress << "Building reference prefix index..." << endl;
+    std::string referenceSeq = readReferenceGenome(referenceGenomePath);
+    std::transform(referenceSeq.begin(), referenceSeq.end(),
+                   referenceSeq.begin(), ::toupper);
+    prefixBuffer = buildPrefixIndex(referenceSeq, fileSize);
+    std::ofstream indexFile(indexPath, std::ios::binary);
+    indexFile.write(prefixBuffer.data(), prefixBuffer.size());
+    if (!indexFile) {
+      *progress << "Warning: Failed to write reference prefix index" << endl;
+    }
+    data = prefixBuffer.data();
+  }
+
+  const uint64_t* header = (const uint64_t*)data;
+  PrefixIndex index;
+  index.length = header[2];
+  index.checksum = header[3];
+  index.blocks = header[4];
+  index.nRuns = header[5];
+  index.gcMask = header + 6;
+  index.gcPrefix = (const uint32_t*)(index.gcMask + index.blocks);
+  index.nRunBounds = index.gcPrefix + index.blocks + 1;
+  return index;
+}
 
-  while (getline(referenceGenomeFile, line)) {
-    referenceGenome += line;
+// number of G and C bases in reference positions [0, pos)
+uint64_t SCCGD::gcBefore(const PrefixIndex& index, uint64_t pos) {
+  uint64_t block = pos / 64;
+  uint64_t rem = pos % 64;
+  if (rem == 0) {
+    return index.gcPrefix[block];
+  }
+  return index.gcPrefix[block] +
+         __builtin_popcountll(index.gcMask[block] & ((1ULL << rem) - 1));
+}
+
+std::string SCCGD::readReferenceGenome(std::string referenceGenomePath) {
+  string text;
+  // check file opened successfully, gzip and BGZF files are decompressed
+  if (!bgzf::readFile(referenceGenomePath, text)) {
+    std::cout << "Error: Failed to open referencreade genome file" << std::endl;
+    std::exit(1);
   }
 
-  return referenceGenome;
+  return fasta::sequence(text);
 }
\ No newline at end of file
@@ -0,0 +1,782 @@
+#ifndef BGZF_H
+#define BGZF_H
+
+// Self-contained gzip / BGZF support, so compressed FASTA files can be read
+// and written without zlib. BGZF files (gzip members carrying their size in a
+// "BC" extra field) are (de)compressed block by block on all cores, any other
+// gzip file is inflated sequentially.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bgzf {
+
+// maximum uncompressed size of a BGZF block, chosen so that even a stored
+// block fits the 64 KB limit
+static const size_t block_input = 0xff00;
+static const unsigned char eof_block[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43,
+    0x02, 0,    0x1b, 0,    3, 0, 0, 0, 0, 0,    0,    0, 0,    0};
+
+inline uint32_t crc32(const unsigned char* data, size_t length,
+                      uint32_t crc = 0) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) {
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      }
+      t[n] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+inline uint32_t readLE32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ---------------------------------------------------------------- inflate
+
+// LSB first bit reader over a memory buffer, sets ok to false on overrun
+struct BitReader {
+  const unsigned char* in;
+  size_t length;
+  size_t pos = 0;
+  uint64_t bitbuf = 0;
+  int bitcnt = 0;
+  bool ok = true;
+
+  BitReader(const unsigned char* in, size_t length) : in(in), length(length) {}
+
+  void fill() {
+    while (bitcnt <= 56 && pos < length) {
+      bitbuf |= (uint64_t)in[pos++] << bitcnt;
+      bitcnt += 8;
+    }
+  }
+
+  int bits(int need) {
+    if (bitcnt < need) {
+      fill();
+      if (bitcnt < need) {
+        ok = false;
+        return 0;
+      }
+    }
+    int value = bitbuf & ((1ULL << need) - 1);
+    bitbuf >>= need;
+    bitcnt -= need;
+    return value;
+  }
+
+  // drops the partial byte and returns unread buffered bytes to the input
+  void align() {
+    bitbuf >>= bitcnt % 8;
+    bitcnt -= bitcnt % 8;
+    pos -= bitcnt / 8;
+    bitbuf = 0;
+    bitcnt = 0;
+  }
+};
+
+// canonical Huffman decoder, codes up to fast_bits long are resolved with a
+// single table lookup, longer ones bit by bit
+struct Huffman {
+  static const int fast_bits = 10;
+  uint16_t count[16];
+  std::vector<uint16_t> symbol;
+  uint16_t fast[1 << fast_bits];  // symbol << 4 | length, 0 if not resolved
+
+  // returns false for over-subscribed code lengths
+  bool build(const uint8_t* lengths, int n) {
+    std::memset(count, 0, sizeof(count));
+    std::memset(fast, 0, sizeof(fast));
+    for (int s = 0; s < n; s++) count[lengths[s]]++;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+      left = (left << 1) - count[len];
+      if (left < 0) return false;
+    }
+
+    uint16_t offs[16];
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + count[len];
+    symbol.assign(n, 0);
+    for (int s = 0; s < n; s++) {
+      if (lengths[s] != 0) symbol[offs[lengths[s]]++] = s;
+    }
+
+    // codes are sent MSB first, so the table is indexed by reversed codes
+    int code = 0;
+    int index = 0;
+    for (int len = 1; len <= fast_bits; len++) {
+      for (int i = 0; i < count[len]; i++, index++, code++) {
+        int reversed = 0;
+        for (int b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+        for (int f = reversed; f < (1 << fast_bits); f += 1 << len) {
+          fast[f] = (symbol[index] << 4) | len;
+        }
+      }
+      code <<= 1;
+    }
+    return true;
+  }
+
+  int decode(BitReader& br) const {
+    if (br.bitcnt < fast_bits) br.fill();
+    uint16_t entry = fast[br.bitbuf & ((1 << fast_bits) - 1)];
+    if (entry != 0 && (entry & 15) <= br.bitcnt) {
+      br.bitbuf >>= entry & 15;
+      br.bitcnt -= entry & 15;
+      return entry >> 4;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+      code |= br.bits(1);
+      if (!br.ok) return -1;
+      int n = count[len];
+      if (code - n < first) return symbol[index + (code - first)];
+      index += n;
+      first = (first + n) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+};
+
+static const uint16_t length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                         1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                         4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,   97,   129,
+    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t code_order[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                       11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+inline bool inflateCodes(BitReader& br, std::string& out, const Huffman& lencode,
+                         const Huffman& distcode) {
+  while (true) {
+    int sym = lencode.decode(br);
+    if (sym < 0) return false;
+    if (sym < 256) {
+      out += (char)sym;
+    } else if (sym == 256) {
+      return true;
+    } else {
+      sym -= 257;
+      if (sym >= 29) return false;
+      size_t len = length_base[sym] + br.bits(length_extra[sym]);
+      int dsym = distcode.decode(br);
+      if (dsym < 0 || dsym >= 30) return false;
+      size_t dist = dist_base[dsym] + br.bits(dist_extra[dsym]);
+      if (!br.ok || dist > out.size()) return false;
+      // copies may overlap their own output
+      size_t from = out.size() - dist;
+      for (size_t i = 0; i < len; i++) out += out[from + i];
+    }
+  }
+}
+
+// inflates a raw DEFLATE stream, br is left at the first byte after it
+inline bool inflate(BitReader& br, std::string& out) {
+  static const std::pair<Huffman, Huffman>* fixed = [] {
+    auto* tables = new std::pair<Huffman, Huffman>();
+    uint8_t lengths[288];
+    for (int s = 0; s < 144; s++) lengths[s] = 8;
+    for (int s = 144; s < 256; s++) lengths[s] = 9;
+    for (int s = 256; s < 280; s++) lengths[s] = 7;
+    for (int s = 280; s < 288; s++) lengths[s] = 8;
+    tables->first.build(lengths, 288);
+    for (int s = 0; s < 30; s++) lengths[s] = 5;
+    tables->second.build(lengths, 30);
+    return tables;
+  }();
+
+  int last;
+  do {
+    last = br.bits(1);
+    int type = br.bits(2);
+    if (!br.ok) return false;
+
+    if (type == 0) {
+      br.align();
+      if (br.pos + 4 > br.length) return false;
+      size_t len = br.in[br.pos] | (br.in[br.pos + 1] << 8);
+      size_t nlen = br.in[br.pos + 2] | (br.in[br.pos + 3] << 8);
+      br.pos += 4;
+      if (len != (~nlen & 0xffff) || br.pos + len > br.length) return false;
+      out.append((const char*)br.in + br.pos, len);
+      br.pos += len;
+    } else if (type == 1) {
+      if (!inflateCodes(br, out, fixed->first, fixed->second)) return false;
+    } else if (type == 2) {
+      int nlen = br.bits(5) + 257;
+      int ndist = br.bits(5) + 1;
+      int ncode = br.bits(4) + 4;
+      if (!br.ok || nlen > 286 || ndist > 30) return false;
+
+      uint8_t lengths[320] = {0};
+      for (int i = 0; i < ncode; i++) lengths[code_order[i]] = br.bits(3);
+      Huffman lencode, distcode;
+      if (!lencode.build(lengths, 19)) return false;
+
+      int index = 0;
+      std::memset(lengths, 0, sizeof(lengths));
+      while (index < nlen + ndist) {
+        int sym = lencode.decode(br);
+        if (sym < 0) return false;
+        if (sym < 16) {
+          lengths[index++] = sym;
+          continue;
+        }
+        int repeat = 0;
+        int len = 0;
+        if (sym == 16) {
+          if (index == 0) return false;
+          len = lengths[index - 1];
+          repeat = 3 + br.bits(2);
+        } else if (sym == 17) {
+          repeat = 3 + br.bits(3);
+        } else {
+          repeat = 11 + br.bits(7);
+        }
+        if (index + repeat > nlen + ndist) return false;
+        while (repeat--) lengths[index++] = len;
+      }
+      if (!br.ok || lengths[256] == 0) return false;
+      if (!lencode.build(lengths, nlen) ||
+          !distcode.build(lengths + nlen, ndist)) {
+        return false;
+      }
+      if (!inflateCodes(br, out, lencode, distcode)) return false;
+    } else {
+      return false;
+    }
+  } while (!last);
+
+  br.align();
+  return true;
+}
+
+// parses a gzip member header at pos, sets dataStart to its DEFLATE data and
+// blockSize to the BGZF block size (0 if the member is not a BGZF block)
+inline bool parseHeader(const std::string& data, size_t pos, size_t& dataStart,
+                        size_t& blockSize) {
+  const unsigned char* p = (const unsigned char*)data.data();
+  size_t n = data.size();
+  if (pos + 10 > n || p[pos] != 0x1f || p[pos + 1] != 0x8b || p[pos + 2] != 8) {
+    return false;
+  }
+  int flags = p[pos + 3];
+  size_t at = pos + 10;
+  blockSize = 0;
+  if (flags & 4) {
+    if (at + 2 > n) return false;
+    size_t xlen = p[at] | (p[at + 1] << 8);
+    size_t end = at + 2 + xlen;
+    if (end > n) return false;
+    for (size_t f = at + 2; f + 4 <= end;) {
+      size_t slen = p[f + 2] | (p[f + 3] << 8);
+      if (p[f] == 'B' && p[f + 1] == 'C' && slen == 2 && f + 6 <= end) {
+        blockSize = (p[f + 4] | (p[f + 5] << 8)) + 1;
+      }
+      f += 4 + slen;
+    }
+    at = end;
+  }
+  for (int flag : {8, 16}) {  // file name and comment
+    if (flags & flag) {
+      while (at < n && p[at] != 0) at++;
+      at++;
+    }
+  }
+  if (flags & 2) at += 2;  // header crc
+  dataStart = at;
+  return at <= n;
+}
+
+// inflates one gzip member starting at pos and checks its trailer
+inline bool inflateMember(const std::string& data, size_t pos, std::string& out,
+                          size_t& next) {
+  size_t dataStart, blockSize;
+  if (!parseHeader(data, pos, dataStart, blockSize)) return false;
+  const unsigned char* p = (const unsigned char*)data.data();
+  BitReader br(p + dataStart, data.size() - dataStart);
+  size_t outStart = out.size();
+  if (!inflate(br, out)) return false;
+
+  size_t trailer = dataStart + br.pos;
+  if (trailer + 8 > data.size()) return false;
+  uint32_t crc = crc32((const unsigned char*)out.data() + outStart,
+                       out.size() - outStart);
+  if (readLE32(p + trailer) != crc ||
+      readLE32(p + trailer + 4) != (uint32_t)(out.size() - outStart)) {
+    return false;
+  }
+  next = trailer + 8;
+  return true;
+}
+
+inline bool isGzip(const std::string& data) {
+  return data.size() >= 2 && (unsigned char)data[0] == 0x1f &&
+         (unsigned char)data[1] == 0x8b;
+}
+
+inline unsigned threadCount() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// decompresses a gzip file, BGZF blocks are inflated in parallel
+inline bool decompress(const std::string& data, std::string& out) {
+  // locate all blocks first, this only needs the BGZF block sizes
+  std::vector<size_t> starts;
+  bool blocked = true;
+  for (size_t pos = 0; pos < data.size();) {
+    size_t dataStart, blockSize;
+    if (!parseHeader(data, pos, dataStart, blockSize) || blockSize < 26 ||
+        pos + blockSize > data.size()) {
+      blocked = false;
+      break;
+    }
+    starts.push_back(pos);
+    pos += blockSize;
+  }
+
+  if (!blocked) {
+    out.clear();
+    size_t pos = 0;
+    while (pos < data.size()) {
+      if (!inflateMember(data, pos, out, pos)) return false;
+      // tolerate zero padding after the last member
+      while (pos < data.size() && data[pos] == 0) pos++;
+    }
+    return true;
+  }
+
+  // output offsets follow from the uncompressed sizes in the trailers
+  const unsigned char* p = (const unsigned char*)data.data();
+  std::vector<size_t> offsets(starts.size() + 1, 0);
+  for (size_t b = 0; b < starts.size(); b++) {
+    size_t end = b + 1 < starts.size() ? starts[b + 1] : data.size();
+    offsets[b + 1] = offsets[b] + readLE32(p + end - 4);
+  }
+  out.assign(offsets.back(), '\0');
+
+  std::atomic<size_t> nextBlock(0);
+  std::atomic<bool> ok(true);
+  auto worker = [&]() {
+    std::string block;
+    for (size_t b = nextBlock++; b < starts.size() && ok; b = nextBlock++) {
+      size_t next;
+      block.clear();
+      if (!inflateMember(data, starts[b], block, next) ||
+          block.size() != offsets[b + 1] - offsets[b]) {
+        ok = false;
+        return;
+      }
+      std::memcpy(&out[offsets[b]], block.data(), block.size());
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < threadCount(); t++) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+  return ok;
+}
+
+// reads a whole file, decompressing it if it is gzip or BGZF compressed.
+// Returns false if the file cannot be opened, exits on corrupt data.
+inline bool readFile(const std::string& path, std::string& contents) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+
+  // pipes and FIFOs cannot seek, read those in chunks
+  contents.clear();
+  std::streamoff size = file.seekg(0, std::ios::end) ? (std::streamoff)file.tellg() : -1;
+  if (size >= 0 && file.seekg(0)) {
+    contents.resize(size);
+    if (!file.read(&contents[0], size)) {
+      std::cout << "Error: Failed to read " << path << std::endl;
+      std::exit(1);
+    }
+  } else {
+    file.clear();
+    char chunk[1 << 16];
+    while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0) {
+      contents.append(chunk, file.gcount());
+    }
+    if (file.bad()) {
+      std::cout << "Error: Failed to read " << path << std::endl;
+      std::exit(1);
+    }
+  }
+
+  if (isGzip(contents)) {
+    std::string data;
+    data.swap(contents);
+    if (!decompress(data, contents)) {
+      std::cout << "Error: Corrupt gzip data in " << path << std::endl;
+      std::exit(1);
+    }
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------- deflate
+
+// LSB first bit writer
+struct BitWriter {
+  std::string out;
+  uint64_t bitbuf = 0;
+  int bitcnt = 0;
+
+  void put(uint32_t value, int n) {
+    bitbuf |= (uint64_t)value << bitcnt;
+    bitcnt += n;
+    while (bitcnt >= 8) {
+      out += (char)(bitbuf & 0xff);
+      bitbuf >>= 8;
+      bitcnt -= 8;
+    }
+  }
+
+  // Huffman codes are sent MSB first
+  void putCode(uint32_t code, int n) {
+    uint32_t reversed = 0;
+    for (int b = 0; b < n; b++) reversed |= ((code >> b) & 1) << (n - 1 - b);
+    put(reversed, n);
+  }
+
+  void flush() {
+    if (bitcnt > 0) put(0, 8 - bitcnt);
+  }
+};
+
+// Huffman code lengths limited to maxBits. Frequencies are halved until the
+// tree fits, and at least two symbols get a code so the code is complete.
+inline void buildLengths(std::vector<uint32_t> freq, int maxBits,
+                         std::vector<uint8_t>& lengths) {
+  int n = freq.size();
+  int used = 0;
+  for (int s = 0; s < n; s++) used += freq[s] != 0;
+  for (int s = 0; used < 2 && s < n; s++) {
+    if (freq[s] == 0) {
+      freq[s] = 1;
+      used++;
+    }
+  }
+
+  while (true) {
+    using Node = std::pair<uint64_t, int>;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+    std::vector<int> parent(2 * n, -1);
+    for (int s = 0; s < n; s++) {
+      if (freq[s] != 0) heap.push(std::make_pair(freq[s], s));
+    }
+    int next = n;
+    while (heap.size() > 1) {
+      Node a = heap.top();
+      heap.pop();
+      Node b = heap.top();
+      heap.pop();
+      parent[a.second] = next;
+      parent[b.second] = next;
+      heap.push(std::make_pair(a.first + b.first, next++));
+    }
+
+    lengths.assign(n, 0);
+    int longest = 0;
+    for (int s = 0; s < n; s++) {
+      if (freq[s] == 0) continue;
+      int depth = 0;
+      for (int node = s; parent[node] != -1; node = parent[node]) depth++;
+      lengths[s] = depth;
+      longest = std::max(longest, depth);
+    }
+    if (longest <= maxBits) return;
+    for (auto& f : freq) {
+      if (f != 0) f = (f + 1) / 2;
+    }
+  }
+}
+
+inline std::vector<uint32_t> canonicalCodes(const std::vector<uint8_t>& lengths) {
+  uint32_t count[16] = {0};
+  for (uint8_t len : lengths) count[len]++;
+  count[0] = 0;
+  uint32_t next[16] = {0};
+  uint32_t code = 0;
+  for (int len = 1; len < 16; len++) {
+    code = (code + count[len - 1]) << 1;
+    next[len] = code;
+  }
+  std::vector<uint32_t> codes(lengths.size(), 0);
+  for (size_t s = 0; s < lengths.size(); s++) {
+    if (lengths[s] != 0) codes[s] = next[lengths[s]]++;
+  }
+  return codes;
+}
+
+// compresses data into a single final dynamic Huffman DEFLATE block using
+// hash chain LZ77 matching, falling back to a stored block if that is smaller
+inline std::string deflate(const unsigned char* data, size_t length) {
+  static const int hash_bits = 15;
+  static const int max_chain = 32;
+  static const size_t window = 32768;
+
+  // LZ77 pass, symbols are literal/length codes with their distance
+  struct Token {
+    uint16_t litlen;  // literal byte or match length
+    uint16_t dist;    // 0 for literals
+  };
+  std::vector<Token> tokens;
+  tokens.reserve(length);
+  std::vector<int32_t> head(1 << hash_bits, -1);
+  std::vector<int32_t> prev(length, -1);
+  auto hash = [&](size_t i) {
+    uint32_t h = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+    return (h * 2654435761u) >> (32 - hash_bits);
+  };
+  auto insert = [&](size_t i) {
+    if (i + 2 < length) {
+      uint32_t h = hash(i);
+      prev[i] = head[h];
+      head[h] = i;
+    }
+  };
+
+  for (size_t i = 0; i < length;) {
+    size_t bestLen = 0, bestDist = 0;
+    if (i + 2 < length) {
+      size_t maxLen = std::min<size_t>(258, length - i);
+      int chain = max_chain;
+      for (int32_t c = head[hash(i)]; c >= 0 && i - c <= window && chain--;
+           c = prev[c]) {
+        size_t len = 0;
+        while (len < maxLen && data[c + len] == data[i + len]) len++;
+        if (len > bestLen) {
+          bestLen = len;
+          bestDist = i - c;
+          if (len == maxLen) break;
+        }
+      }
+    }
+    if (bestLen >= 3) {
+      tokens.push_back({(uint16_t)bestLen, (uint16_t)bestDist});
+      for (size_t k = 0; k < bestLen; k++) insert(i + k);
+      i += bestLen;
+    } else {
+      tokens.push_back({data[i], 0});
+      insert(i);
+      i++;
+    }
+  }
+
+  auto lengthSymbol = [](int len) {
+    int s = 28;
+    while (length_base[s] > len) s--;
+    return s;
+  };
+  auto distSymbol = [](int dist) {
+    int s = 29;
+    while (dist_base[s] > dist) s--;
+    return s;
+  };
+
+  std::vector<uint32_t> litFreq(286, 0), distFreq(30, 0);
+  for (const Token& t : tokens) {
+    if (t.dist == 0) {
+      litFreq[t.litlen]++;
+    } else {
+      litFreq[257 + lengthSymbol(t.litlen)]++;
+      distFreq[distSymbol(t.dist)]++;
+    }
+  }
+  litFreq[256] = 1;
+
+  std::vector<uint8_t> litLengths, distLengths;
+  buildLengths(litFreq, 15, litLengths);
+  buildLengths(distFreq, 15, distLengths);
+  int nlen = 286;
+  while (nlen > 257 && litLengths[nlen - 1] == 0) nlen--;
+  int ndist = 30;
+  while (ndist > 1 && distLengths[ndist - 1] == 0) ndist--;
+
+  // run length encode the code lengths with symbols 16, 17 and 18
+  std::vector<uint8_t> all(litLengths.begin(), litLengths.begin() + nlen);
+  all.insert(all.end(), distLengths.begin(), distLengths.begin() + ndist);
+  std::vector<std::pair<int, int>> rle;  // symbol, extra bits value
+  for (size_t i = 0; i < all.size();) {
+    size_t run = 1;
+    while (i + run < all.size() && all[i + run] == all[i]) run++;
+    if (all[i] == 0 && run >= 3) {
+      run = std::min<size_t>(run, 138);
+      rle.push_back(run >= 11 ? std::make_pair(18, (int)run - 11)
+                              : std::make_pair(17, (int)run - 3));
+    } else if (all[i] != 0 && run >= 4) {
+      run = std::min<size_t>(run, 7);
+      rle.push_back(std::make_pair(all[i], 0));
+      rle.push_back(std::make_pair(16, (int)run - 4));
+    } else {
+      run = 1;
+      rle.push_back(std::make_pair(all[i], 0));
+    }
+    i += run;
+  }
+  std::vector<uint32_t> codeFreq(19, 0);
+  for (const auto& r : rle) codeFreq[r.first]++;
+  std::vector<uint8_t> codeLengths;
+  buildLengths(codeFreq, 7, codeLengths);
+  int ncode = 19;
+  while (ncode > 4 && codeLengths[code_order[ncode - 1]] == 0) ncode--;
+
+  std::vector<uint32_t> litCodes = canonicalCodes(litLengths);
+  std::vector<uint32_t> distCodes = canonicalCodes(distLengths);
+  std::vector<uint32_t> codeCodes = canonicalCodes(codeLengths);
+
+  BitWriter bw;
+  bw.out.reserve(length / 2);
+  bw.put(1, 1);  // final block
+  bw.put(2, 2);  // dynamic Huffman
+  bw.put(nlen - 257, 5);
+  bw.put(ndist - 1, 5);
+  bw.put(ncode - 4, 4);
+  for (int i = 0; i < ncode; i++) bw.put(codeLengths[code_order[i]], 3);
+  for (const auto& r : rle) {
+    bw.putCode(codeCodes[r.first], codeLengths[r.first]);
+    if (r.first == 16) bw.put(r.second, 2);
+    if (r.first == 17) bw.put(r.second, 3);
+    if (r.first == 18) bw.put(r.second, 7);
+  }
+  for (const Token& t : tokens) {
+    if (t.dist == 0) {
+      bw.putCode(litCodes[t.litlen], litLengths[t.litlen]);
+    } else {
+      int ls = lengthSymbol(t.litlen);
+      bw.putCode(litCodes[257 + ls], litLengths[257 + ls]);
+      bw.put(t.litlen - length_base[ls], length_extra[ls]);
+      int ds = distSymbol(t.dist);
+      bw.putCode(distCodes[ds], distLengths[ds]);
+      bw.put(t.dist - dist_base[ds], dist_extra[ds]);
+    }
+  }
+  bw.putCode(litCodes[256], litLengths[256]);
+  bw.flush();
+
+  if (bw.out.size() <= length + 5) return bw.out;
+
+  // stored block
+  std::string stored;
+  stored += (char)1;
+  stored += (char)(length & 0xff);
+  stored += (char)(length >> 8);
+  stored += (char)(~length & 0xff);
+  stored += (char)((~length >> 8) & 0xff);
+  stored.append((const char*)data, length);
+  return stored;
+}
+
+// wraps at most block_input bytes into a BGZF block
+inline std::string compressBlock(const unsigned char* data, size_t length) {
+  std::string cdata = deflate(data, length);
+  size_t blockSize = 18 + cdata.size() + 8;
+  std::string block(eof_block, eof_block + 16);
+  block += (char)((blockSize - 1) & 0xff);
+  block += (char)((blockSize - 1) >> 8);
+  block += cdata;
+  uint32_t crc = crc32(data, length);
+  for (uint32_t v : {crc, (uint32_t)length}) {
+    for (int b = 0; b < 4; b++) block += (char)((v >> (8 * b)) & 0xff);
+  }
+  return block;
+}
+
+// streams data into a BGZF file, input is buffered into batches of blocks
+// which are compressed in parallel and appended as soon as they are full
+class Writer {
+ public:
+  bool open(const std::string& path) {
+    file.open(path, std::ios::binary);
+    return file.is_open();
+  }
+
+  bool write(const char* data, size_t length) {
+    buffer.append(data, length);
+    if (buffer.size() >= batchSize()) flush(false);
+    return (bool)file;
+  }
+
+  bool write(const std::string& data) { return write(data.data(), data.size()); }
+
+  // compresses what is left and appends the end of file marker
+  bool close() {
+    flush(true);
+    file.write((const char*)eof_block, sizeof(eof_block));
+    file.close();
+    return !file.fail();
+  }
+
+ private:
+  std::ofstream file;
+  std::string buffer;
+
+  static size_t batchSize() { return threadCount() * 16 * block_input; }
+
+  // compresses the buffered full blocks, and the partial last one if final
+  void flush(bool final) {
+    size_t blocks = final ? (buffer.size() + block_input - 1) / block_input
+                          : buffer.size() / block_input;
+    std::vector<std::string> compressed(blocks);
+    std::atomic<size_t> nextBlock(0);
+    auto worker = [&]() {
+      for (size_t b = nextBlock++; b < blocks; b = nextBlock++) {
+        size_t start = b * block_input;
+        compressed[b] = compressBlock((const unsigned char*)buffer.data() + start,
+                                      std::min(block_input, buffer.size() - start));
+      }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < std::min<size_t>(threadCount(), blocks); t++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) thread.join();
+
+    for (const auto& block : compressed) file << block;
+    buffer.erase(0, std::min(buffer.size(), blocks * block_input));
+  }
+};
+
+// writes data as a BGZF file
+inline bool writeFile(const std::string& path, const std::string& data) {
+  Writer writer;
+  if (!writer.open(path)) return false;
+  writer.write(data);
+  return writer.close();
+}
+
+}  // namespace bgzf
+
+#endif  // BGZF_H
@@ -0,0 +1,113 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+// CRC32C (Castagnoli) checksums used to tie an archive to its reference and
+// to verify decompressed blocks. Uses the SSE4.2 crc32 instruction when the
+// CPU has it and a slicing-by-8 table implementation otherwise.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace crc32c {
+
+inline uint32_t software(const unsigned char* data, size_t length,
+                         uint32_t crc) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(8 * 256);
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) {
+        c = c & 1 ? 0x82f63b78 ^ (c >> 1) : c >> 1;
+      }
+      t[n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+      for (int s = 1; s < 8; s++) {
+        t[s * 256 + n] = t[t[(s - 1) * 256 + n] & 0xff] ^ (t[(s - 1) * 256 + n] >> 8);
+      }
+    }
+    return t;
+  }();
+  const uint32_t* t = table.data();
+
+  crc = ~crc;
+  while (length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    word ^= crc;
+    crc = t[7 * 256 + (word & 0xff)] ^ t[6 * 256 + ((word >> 8) & 0xff)] ^
+          t[5 * 256 + ((word >> 16) & 0xff)] ^ t[4 * 256 + ((word >> 24) & 0xff)] ^
+          t[3 * 256 + ((word >> 32) & 0xff)] ^ t[2 * 256 + ((word >> 40) & 0xff)] ^
+          t[1 * 256 + ((word >> 48) & 0xff)] ^ t[word >> 56];
+    data += 8;
+    length -= 8;
+  }
+  while (length--) {
+    crc = t[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t hardware(
+    const unsigned char* data, size_t length, uint32_t crc) {
+  uint64_t c = ~crc;
+  while (length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    c = _mm_crc32_u64(c, word);
+    data += 8;
+    length -= 8;
+  }
+  uint32_t c32 = c;
+  while (length--) {
+    c32 = _mm_crc32_u8(c32, *data++);
+  }
+  return ~c32;
+}
+#endif
+
+inline uint32_t checksum(const void* data, size_t length, uint32_t crc = 0) {
+#if defined(__x86_64__)
+  static const bool sse42 = __builtin_cpu_supports("sse4.2");
+  if (sse42) {
+    return hardware((const unsigned char*)data, length, crc);
+  }
+#endif
+  return software((const unsigned char*)data, length, crc);
+}
+
+// checksums of consecutive blockSize byte blocks of data, computed on all
+// cores since blocks are independent
+inline std::vector<uint32_t> blockChecksums(const std::string& data,
+                                            size_t blockSize) {
+  size_t blocks = (data.size() + blockSize - 1) / blockSize;
+  std::vector<uint32_t> checksums(blocks);
+  std::atomic<size_t> nextBlock(0);
+  auto worker = [&]() {
+    for (size_t b = nextBlock++; b < blocks; b = nextBlock++) {
+      size_t start = b * blockSize;
+      checksums[b] = checksum(data.data() + start,
+                              std::min(blockSize, data.size() - start));
+    }
+  };
+  std::vector<std::thread> threads;
+  unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned t = 1; t < threadCount; t++) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+  return checksums;
+}
+
+}  // namespace crc32c
+
+#endif  // CRC32C_H
@@ -0,0 +1,47 @@
+#ifndef FASTA_H
+#define FASTA_H
+
+// FASTA helpers shared by the compressor and the decompressor.
+
+#include <string>
+
+namespace fasta {
+
+// concatenates the sequence lines of a FASTA file, skipping the header
+inline std::string sequence(const std::string& text) {
+  std::string sequence = "";
+  size_t start = text.find('\n');
+  if (start == std::string::npos) {
+    return sequence;
+  }
+  sequence.reserve(text.length() - start);
+  for (size_t i = start + 1; i < text.length(); i++) {
+    if (text[i] != '\n') {
+      sequence += text[i];
+    }
+  }
+  return sequence;
+}
+
+// complementary base, other characters such as N are kept
+inline char complement(char c) {
+  switch (c) {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    case 'T': return 'A';
+    default: return c;
+  }
+}
+
+inline std::string reverseComplement(const std::string& input) {
+  std::string result(input.rbegin(), input.rend());
+  for (char& c : result) {
+    c = complement(c);
+  }
+  return result;
+}
+
+}  // namespace fasta
+
+#endif  // FASTA_H